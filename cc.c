@@ -1,22 +1,43 @@
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "vector.h"
 
+/*
+ * When set, fatalf() unwinds to the compile server's request handler or to a
+ * lexer worker thread instead of exiting.
+ */
+static _Thread_local jmp_buf *fatal_jmp = NULL;
+/* Lexer workers report errors by re-lexing serially, so they stay silent. */
+static _Thread_local bool fatal_quiet = false;
+
 static inline void fatalf(const char *format, ...) {
   va_list args;
 
-  va_start(args, format);
-  vfprintf(stderr, format, args);
-  va_end(args);
+  if (!fatal_quiet) {
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+  }
 
+  if (fatal_jmp)
+    longjmp(*fatal_jmp, 1);
   exit(1);
 }
 
@@ -182,6 +203,9 @@ typedef struct BasicBlockData {
   /* Terminator instruction of the current block */
   IRJmp jmp;
 
+  /* Execution count read from the `--profile-use` profile, 0 if absent. */
+  u64 count;
+
   /* Used in the cfg. */
   struct BasicBlockData *cfg_next_bb;
   /* Used in the hash table. */
@@ -329,187 +353,232 @@ static Token read_keywords(const char *prog, const char **p, i64 *line,
   return tok;
 }
 
+/*
+ * Maximal-munch recognizer for punctuators, generated from PUNCTUATORS(X).
+ *
+ * Every byte that occurs in some punctuator is mapped to a small class (class
+ * 0 means "not part of any punctuator") and the trie of all punctuators is
+ * stored as a transition table indexed by state and class. State 0 is the root
+ * and doubles as the dead state, since no transition leads back to it.
+ */
+#define PUNCT_LEN(NAME, LITERAL) +(sizeof(LITERAL) - 1)
+enum {
+  /* The trie never has more states than the punctuators have bytes. */
+  PUNCT_MAX_STATES = 1 PUNCTUATORS(PUNCT_LEN),
+  PUNCT_MAX_CLASSES = 32,
+};
+_Static_assert(PUNCT_MAX_STATES <= 256, "punctuator states must fit in u8");
+
+static u8 punct_class[256];
+static u8 punct_next[PUNCT_MAX_STATES][PUNCT_MAX_CLASSES];
+static TokenKind punct_accept[PUNCT_MAX_STATES];
+
+static void init_punctuators(void) {
+  typedef struct PunctPair {
+    const char *literal;
+    TokenKind kind;
+  } PunctPair;
+
+  static const PunctPair punct_list[] = {
+#define PUNCT_PAIR(NAME, LITERAL) {.literal = LITERAL, .kind = TK_##NAME},
+      PUNCTUATORS(PUNCT_PAIR)};
+
+  u64 npuncts = sizeof(punct_list) / sizeof(PunctPair);
+  u32 nclasses = 1;
+  u32 nstates = 1;
+
+  for (u64 i = 0; i < npuncts; ++i) {
+    u8 state = 0;
+    for (const char *c = punct_list[i].literal; *c; ++c) {
+      u8 *class = &punct_class[(u8)*c];
+      if (!*class) {
+        assert(nclasses < PUNCT_MAX_CLASSES);
+        *class = nclasses++;
+      }
+
+      u8 *next = &punct_next[state][*class];
+      if (!*next)
+        *next = nstates++;
+      state = *next;
+    }
+    punct_accept[state] = punct_list[i].kind;
+  }
+}
+
 static Token read_punctuator(const char *prog, const char **p, i64 *line,
                              i64 *col) {
-  TokenKind kind;
+  TokenKind kind = TK_INVALID;
+  u64 tok_len = 0;
+  u8 state = 0;
+
+  /* The null terminator is in class 0, so this never runs off the buffer. */
+  for (u64 i = 0; (state = punct_next[state][punct_class[(u8)(*p)[i]]]); ++i) {
+    if (punct_accept[state] != TK_INVALID) {
+      kind = punct_accept[state];
+      tok_len = i + 1;
+    }
+  }
 
-  static const u64 toks_len[] = {
-#define TOK_LEN(NAME, LITERAL) [TK_##NAME] = strlen(LITERAL),
-      PUNCTUATORS(TOK_LEN)};
+  if (kind == TK_INVALID)
+    return NULL;
 
-  switch ((*p)[0]) {
-  case '[':
-    kind = TK_LBRACKET;
-    break;
-  case ']':
-    kind = TK_RBRACKET;
-    break;
-  case '(':
-    kind = TK_LPAREN;
-    break;
-  case ')':
-    kind = TK_RPAREN;
-    break;
-  case '{':
-    kind = TK_LBRACE;
-    break;
-  case '}':
-    kind = TK_RBRACE;
-    break;
-  case '~':
-    kind = TK_BITNOT;
-    break;
-  case '?':
-    kind = TK_QUESTION;
-    break;
-  case ';':
-    kind = TK_SEMICOLON;
-    break;
-  case ',':
-    kind = TK_COMMA;
-    break;
-  case '.':
-    if (startswith(*p, "...")) {
-      kind = TK_ELIPSIS;
-    } else {
-      kind = TK_DOT;
-    }
-    break;
-  case '&':
-    if (startswith(*p, "&=")) {
-      kind = TK_ANDEQ;
-    } else if (startswith(*p, "&&")) {
-      kind = TK_AND;
-    } else {
-      kind = TK_AMPERSAND;
-    }
-    break;
-  case '*':
-    if (startswith(*p, "*=")) {
-      kind = TK_TIMESEQ;
-    } else {
-      kind = TK_ASTERISK;
-    }
-    break;
-  case '+':
-    if (startswith(*p, "++")) {
-      kind = TK_INCR;
-    } else if (startswith(*p, "+=")) {
-      kind = TK_PLUSEQ;
-    } else {
-      kind = TK_PLUS;
-    }
-    break;
-  case '-':
-    if (startswith(*p, "->")) {
-      kind = TK_ARROW;
-    } else if (startswith(*p, "--")) {
-      kind = TK_DECR;
-    } else if (startswith(*p, "-=")) {
-      kind = TK_MINUSEQ;
-    } else {
-      kind = TK_MINUS;
-    }
-    break;
-  case '!':
-    if (startswith(*p, "!=")) {
-      kind = TK_NE;
-    } else {
-      kind = TK_NOT;
-    }
-    break;
-  case '/':
-    if (startswith(*p, "/=")) {
-      kind = TK_DIVIDEEQ;
-    } else {
-      kind = TK_DIVIDE;
-    }
-    break;
-  case '%':
-    if (startswith(*p, "%=")) {
-      kind = TK_MODEQ;
-    } else if (startswith(*p, "%>")) {
-      kind = TK_RBRACE_ALIAS;
-    } else if (startswith(*p, "%:%:")) {
-      kind = TK_HASH2_ALIAS;
-    } else if (startswith(*p, "%:")) {
-      kind = TK_HASH_ALIAS;
-    } else {
-      kind = TK_MOD;
-    }
-    break;
-  case '<':
-    if (startswith(*p, "<<=")) {
-      kind = TK_LSHIFTEQ;
-    } else if (startswith(*p, "<<")) {
-      kind = TK_LSHIFT;
-    } else if (startswith(*p, "<=")) {
-      kind = TK_LE;
-    } else if (startswith(*p, "<:")) {
-      kind = TK_LBRACKET_ALIAS;
-    } else if (startswith(*p, "<%")) {
-      kind = TK_LBRACE_ALIAS;
-    } else {
-      kind = TK_LT;
-    }
-    break;
-  case '>':
-    if (startswith(*p, ">>=")) {
-      kind = TK_RSHIFTEQ;
-    } else if (startswith(*p, ">>")) {
-      kind = TK_RSHIFT;
-    } else if (startswith(*p, ">=")) {
-      kind = TK_GE;
-    } else {
-      kind = TK_GT;
-    }
-    break;
-  case '=':
-    if (startswith(*p, "==")) {
-      kind = TK_EQ;
-    } else {
-      kind = TK_ASSIGN;
+  Token tok = make_token(kind, (*p - prog), tok_len, *line, *col);
+  (*p) += tok_len;
+  (*col) += tok_len;
+  return tok;
+}
+
+/* Tokenizes [p, end), which must not split a token. */
+static void tokenize(const char *prog, const char *p, const char *end,
+                     i64 *line, i64 *column, Vector *tokens) {
+  while (p < end) {
+    Token tok;
+    /*
+     * token:
+     *   keyword
+     *   identifier
+     *   constant
+     *   string-literal
+     *   punctuator
+     */
+    consume_whitespace(&p, line, column);
+    if (p >= end)
+      break;
+
+    /* Try to read keyword */
+    if ((tok = read_keywords(prog, &p, line, column)) != NULL) {
+      vector_append(tokens, tok);
+      continue;
     }
-    break;
-  case '^':
-    if (startswith(*p, "^=")) {
-      kind = TK_XOREQ;
-    } else {
-      kind = TK_XOR;
+
+    /* Try to read constant (number literal) */
+    if ((tok = read_constant(prog, &p, line, column)) != NULL) {
+      vector_append(tokens, tok);
+      continue;
     }
-    break;
-  case '|':
-    if (startswith(*p, "|=")) {
-      kind = TK_OREQ;
-    } else if (startswith(*p, "||")) {
-      kind = TK_OR;
-    } else {
-      kind = TK_BITOR;
+
+    /* Try to read punctuator */
+    if ((tok = read_punctuator(prog, &p, line, column)) != NULL) {
+      vector_append(tokens, tok);
+      continue;
     }
-    break;
-  case ':':
-    if (startswith(*p, ":>")) {
-      kind = TK_RBRACKET_ALIAS;
-    } else {
-      kind = TK_COLON;
+
+    fatalf("failed to parse the rest of the program: '%s'\n", p);
+  }
+}
+
+/*
+ * Parallel tokenizer.
+ *
+ * The buffer is split into chunks that start at the first non-whitespace byte
+ * after a newline, so no token straddles two chunks. Each chunk is lexed on its
+ * own thread as if it started at line 0, column 0, and the positions are fixed
+ * up afterwards with the prefix sums of the lines and columns every preceding
+ * chunk advanced over. If any chunk fails the whole buffer is lexed again
+ * serially, which reports the same error the serial lexer would.
+ */
+
+/* Inputs are only split automatically when every chunk gets this much. */
+#define LEX_CHUNK_MIN_BYTES (256 * 1024)
+
+typedef struct LexChunk {
+  const char *prog;
+  const char *start;
+  const char *end;
+  /* Lines and columns advanced over the chunk. */
+  i64 line;
+  i64 column;
+  Vector *tokens;
+  bool failed;
+} LexChunk;
+
+static void *tokenize_chunk(void *arg) {
+  LexChunk *chunk = arg;
+  jmp_buf env;
+  /* Chunks may run on the caller's thread, whose handler must survive. */
+  jmp_buf *saved_jmp = fatal_jmp;
+  bool saved_quiet = fatal_quiet;
+
+  fatal_quiet = true;
+  if (setjmp(env) == 0) {
+    fatal_jmp = &env;
+    tokenize(chunk->prog, chunk->start, chunk->end, &chunk->line,
+             &chunk->column, chunk->tokens);
+  } else {
+    chunk->failed = true;
+  }
+  fatal_jmp = saved_jmp;
+  fatal_quiet = saved_quiet;
+  return NULL;
+}
+
+static void tokenize_parallel(const char *prog, u64 len, int njobs,
+                              Vector *tokens) {
+  LexChunk *chunks = calloc(njobs, sizeof(LexChunk));
+  pthread_t *threads = calloc(njobs, sizeof(pthread_t));
+  if (!chunks || !threads)
+    fatalf("failed to allocate memory\n");
+
+  const char *end = prog + len;
+  const char *start = prog;
+  int nchunks = 0;
+  while (start < end) {
+    /* The last chunk takes whatever is left. */
+    const char *split = end;
+    if (nchunks < njobs - 1) {
+      split = prog + len / njobs * (nchunks + 1);
+      if (split <= start)
+        split = start + 1;
+      while (split < end && split[-1] != '\n')
+        ++split;
+      while (split < end && isspace(split[0]))
+        ++split;
     }
-    break;
-  case '#':
-    if (startswith(*p, "##")) {
-      kind = TK_HASH2;
-    } else {
-      kind = TK_HASH;
+
+    LexChunk *chunk = &chunks[nchunks++];
+    chunk->prog = prog;
+    chunk->start = start;
+    chunk->end = split;
+    chunk->tokens = make_vector();
+    start = split;
+  }
+
+  int nthreads = 0;
+  for (; nthreads < nchunks; ++nthreads) {
+    if (pthread_create(&threads[nthreads], NULL, tokenize_chunk,
+                       &chunks[nthreads]) != 0)
+      break;
+  }
+  /* Chunks that did not get a thread are lexed on this one. */
+  for (int i = nthreads; i < nchunks; ++i)
+    tokenize_chunk(&chunks[i]);
+  for (int i = 0; i < nthreads; ++i)
+    pthread_join(threads[i], NULL);
+
+  bool failed = false;
+  for (int i = 0; i < nchunks; ++i)
+    failed |= chunks[i].failed;
+
+  i64 line = 1, column = 0;
+  for (int i = 0; i < nchunks; ++i) {
+    LexChunk *chunk = &chunks[i];
+    for (int j = 0; !failed && j < vector_len(chunk->tokens); ++j) {
+      Token tok = vector_get(chunk->tokens, j);
+      tok->line += line;
+      tok->column += column;
+      vector_append(tokens, tok);
     }
-    break;
-  default:
-    return NULL;
+    line += chunk->line;
+    column += chunk->column;
+    free_vector(chunk->tokens);
   }
+  free(threads);
+  free(chunks);
 
-  u64 tok_len = toks_len[kind];
-  Token tok = make_token(kind, (*p - prog), tok_len, *line, *col);
-  (*p) += tok_len;
-  (*col) += tok_len;
-  return tok;
+  if (failed) {
+    line = 1, column = 0;
+    tokenize(prog, prog, end, &line, &column, tokens);
+  }
 }
 
 static Expr *parse_expr(const char *prog, Token **tok_ref) {
@@ -543,6 +612,23 @@ static int flag_debug_dump_ast = 0;
 static int flag_debug_only_parse = 0;
 static int flag_debug_dump_ir = 0;
 static int flag_debug_only_dump_ir = 0;
+static const char *flag_server = NULL;
+static const char *flag_client = NULL;
+static int flag_server_jobs = 0;
+static const char *flag_instrument = NULL;
+static const char *flag_profile_use = NULL;
+static int flag_lex_jobs = 0;
+static const char *flag_source = NULL;
+
+enum {
+  OPT_SERVER = 256,
+  OPT_CLIENT,
+  OPT_SERVER_JOBS,
+  OPT_INSTRUMENT,
+  OPT_PROFILE_USE,
+  OPT_LEX_JOBS,
+  OPT_SOURCE,
+};
 
 static void parse_args(int argc, char **argv) {
   int c;
@@ -554,6 +640,13 @@ static void parse_args(int argc, char **argv) {
       {"debug-dump-ast", no_argument, &flag_debug_dump_ast, 1},
       {"debug-only-dump-ir", no_argument, &flag_debug_only_dump_ir, 1},
       {"debug-dump-ir", no_argument, &flag_debug_dump_ir, 1},
+      {"server", required_argument, NULL, OPT_SERVER},
+      {"client", required_argument, NULL, OPT_CLIENT},
+      {"server-jobs", required_argument, NULL, OPT_SERVER_JOBS},
+      {"instrument", optional_argument, NULL, OPT_INSTRUMENT},
+      {"profile-use", required_argument, NULL, OPT_PROFILE_USE},
+      {"lex-jobs", required_argument, NULL, OPT_LEX_JOBS},
+      {"source", required_argument, NULL, OPT_SOURCE},
       {0, 0, 0, 0},
   };
 
@@ -564,9 +657,54 @@ static void parse_args(int argc, char **argv) {
     if (c == -1) {
       break;
     }
+
+    switch (c) {
+    case OPT_SERVER:
+      flag_server = optarg;
+      break;
+    case OPT_CLIENT:
+      flag_client = optarg;
+      break;
+    case OPT_SERVER_JOBS:
+      flag_server_jobs = atoi(optarg);
+      break;
+    case OPT_INSTRUMENT:
+      flag_instrument = optarg ? optarg : "cc.prof";
+      break;
+    case OPT_PROFILE_USE:
+      flag_profile_use = optarg;
+      break;
+    case OPT_LEX_JOBS:
+      flag_lex_jobs = atoi(optarg);
+      break;
+    case OPT_SOURCE:
+      flag_source = optarg;
+      break;
+    default:
+      break;
+    }
   }
 }
 
+/* Restore every flag and the getopt state before parsing a new request. */
+static void reset_args(void) {
+  flag_debug_dump_tokens = 0;
+  flag_debug_only_tokenize = 0;
+  flag_debug_dump_ast = 0;
+  flag_debug_only_parse = 0;
+  flag_debug_dump_ir = 0;
+  flag_debug_only_dump_ir = 0;
+  flag_server = NULL;
+  flag_client = NULL;
+  flag_server_jobs = 0;
+  flag_instrument = NULL;
+  flag_profile_use = NULL;
+  flag_lex_jobs = 0;
+  flag_source = NULL;
+  /* glibc fully reinitializes getopt when optind is 0. */
+  optind = 0;
+}
+
 void debug_dump_tokens(const char *prog, Vector *tokens) {
   for (int i = 0; i < vector_len(tokens); ++i) {
     Token tok = vector_get(tokens, i);
@@ -591,10 +729,140 @@ void debug_dump_tokens(const char *prog, Vector *tokens) {
   }
 }
 
-int main(int argc, char *argv[]) {
-  parse_args(argc, argv);
+/*
+ * Block profiles.
+ *
+ * A profile is a header of two native-endian u64s, PROFILE_MAGIC and the
+ * number of basic blocks, followed by one u64 execution count per block indexed
+ * by the block id. `--instrument` makes the generated code count every block
+ * entry and write the profile to a file when the program exits, and
+ * `--profile-use` reads it back into the `count` of each block.
+ */
+
+/* "CCPROF\0\1" when stored little-endian. */
+#define PROFILE_MAGIC 0x0100464f52504343ull
+
+static u32 count_bbs(BasicBlock entry) {
+  u32 nbb = 0;
+  BasicBlock curbb = NULL;
+  for (curbb = entry; curbb; curbb = curbb->cfg_next_bb) {
+    if (curbb->id >= nbb)
+      nbb = curbb->id + 1;
+  }
+  return nbb;
+}
+
+static void load_profile(const char *path, BasicBlock entry) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    fatalf("failed to open profile '%s': %s\n", path, strerror(errno));
+
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  rewind(f);
+
+  u64 header[2];
+  if (size < 0 || size % sizeof(u64) != 0 ||
+      fread(header, sizeof(header), 1, f) != 1 || header[0] != PROFILE_MAGIC)
+    fatalf("malformed profile '%s'\n", path);
+
+  u32 nbb = count_bbs(entry);
+  if (header[1] != nbb || (u64)size != sizeof(header) + nbb * sizeof(u64))
+    fatalf("profile '%s' has %lu blocks, the program has %u\n", path,
+           header[1], nbb);
+
+  u64 *counts = malloc(nbb * sizeof(u64));
+  if (!counts)
+    fatalf("failed to allocate memory\n");
+  if (fread(counts, sizeof(u64), nbb, f) != nbb)
+    fatalf("malformed profile '%s'\n", path);
+  fclose(f);
+
+  BasicBlock curbb = NULL;
+  for (curbb = entry; curbb; curbb = curbb->cfg_next_bb)
+    curbb->count = counts[curbb->id];
+  free(counts);
+}
+
+static void emit_profile_counter(BasicBlock bb) {
+  printf("\tincq __cc_prof_counters+%u(%%rip)\n", bb->id * 8);
+}
+
+/*
+ * Emits the profile and a destructor dumping it with raw syscalls. Every run
+ * overwrites the file, so profiles from several runs must be merged by hand.
+ */
+static void emit_profile_runtime(BasicBlock entry, const char *path) {
+  u32 nbb = count_bbs(entry);
+
+  printf("\t.data\n");
+  printf("\t.p2align 3\n");
+  printf("__cc_prof_data:\n");
+  printf("\t.quad %#llx\n", PROFILE_MAGIC);
+  printf("\t.quad %u\n", nbb);
+  printf("__cc_prof_counters:\n");
+  printf("\t.zero %u\n", nbb * 8);
+
+  printf("\t.section .rodata\n");
+  printf("__cc_prof_path:\n");
+  printf("\t.asciz \"");
+  for (const char *c = path; *c; ++c) {
+    if (*c == '"' || *c == '\\')
+      putchar('\\');
+    putchar(*c);
+  }
+  printf("\"\n");
+
+  printf("\t.text\n");
+  printf("__cc_prof_dump:\n");
+  /* fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) */
+  printf("\tmovl $2, %%eax\n");
+  printf("\tleaq __cc_prof_path(%%rip), %%rdi\n");
+  printf("\tmovl $0x241, %%esi\n");
+  printf("\tmovl $0644, %%edx\n");
+  printf("\tsyscall\n");
+  printf("\ttestl %%eax, %%eax\n");
+  printf("\tjs 1f\n");
+  /* write(fd, profile, size); close(fd) */
+  printf("\tmovl %%eax, %%edi\n");
+  printf("\tmovl $1, %%eax\n");
+  printf("\tleaq __cc_prof_data(%%rip), %%rsi\n");
+  printf("\tmovl $%u, %%edx\n", 16 + nbb * 8);
+  printf("\tsyscall\n");
+  printf("\tmovl $3, %%eax\n");
+  printf("\tsyscall\n");
+  printf("1:\n");
+  printf("\tret\n");
+
+  printf("\t.section .fini_array, \"aw\"\n");
+  printf("\t.p2align 3\n");
+  printf("\t.quad __cc_prof_dump\n");
+}
+
+/* Reads a whole source file into a null-terminated buffer. */
+static char *read_source(const char *path) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    fatalf("failed to open source '%s': %s\n", path, strerror(errno));
+
+  fseek(f, 0, SEEK_END);
+  long len = ftell(f);
+  rewind(f);
+  if (len < 0)
+    fatalf("failed to read source '%s': %s\n", path, strerror(errno));
+
+  char *buf = malloc(len + 1);
+  if (!buf)
+    fatalf("failed to allocate memory\n");
+  if (fread(buf, 1, len, f) != (size_t)len)
+    fatalf("failed to read source '%s'\n", path);
+  buf[len] = '\0';
+  fclose(f);
+  return buf;
+}
 
-  if (optind >= argc)
+static int compile(int argc, char **argv) {
+  if (!flag_source && optind >= argc)
     fatalf("incorrect number of arguments\n");
 
   if (flag_debug_only_parse && flag_debug_only_tokenize)
@@ -602,43 +870,24 @@ int main(int argc, char *argv[]) {
            "be specified\n");
 
   /* Tokenizer ... */
-  /* p is a null-terminated string. */
-  const char *prog = argv[optind];
-  const char *p = argv[optind];
-  i64 line = 1, column = 0;
-  Vector *tokens = make_vector();
-  while (p[0]) {
-    Token tok;
-    /*
-     * token:
-     *   keyword
-     *   identifier
-     *   constant
-     *   string-literal
-     *   punctuator
-     */
-    consume_whitespace(&p, &line, &column);
-
-    /* Try to read keyword */
-    if ((tok = read_keywords(prog, &p, &line, &column)) != NULL) {
-      vector_append(tokens, tok);
-      continue;
-    }
-
-    /* Try to read constant (number literal) */
-    if ((tok = read_constant(prog, &p, &line, &column)) != NULL) {
-      vector_append(tokens, tok);
-      continue;
-    }
-
-    /* Try to read punctuator */
-    if ((tok = read_punctuator(prog, &p, &line, &column)) != NULL) {
-      vector_append(tokens, tok);
-      continue;
-    }
+  /* prog is a null-terminated string. */
+  const char *prog = flag_source ? read_source(flag_source) : argv[optind];
+  u64 prog_len = strlen(prog);
+  int lex_jobs = flag_lex_jobs;
+  if (lex_jobs <= 0) {
+    lex_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (lex_jobs <= 0)
+      lex_jobs = 1;
+    if ((u64)lex_jobs > prog_len / LEX_CHUNK_MIN_BYTES)
+      lex_jobs = prog_len / LEX_CHUNK_MIN_BYTES;
+  }
 
-    if (p[0])
-      fatalf("failed to parse the rest of the program: '%s'\n", p);
+  Vector *tokens = make_vector();
+  if (lex_jobs > 1) {
+    tokenize_parallel(prog, prog_len, lex_jobs, tokens);
+  } else {
+    i64 line = 1, column = 0;
+    tokenize(prog, prog, prog + prog_len, &line, &column, tokens);
   }
 
   vector_append(tokens, make_token(TK_EOF, 0, 0, -1, -1));
@@ -647,7 +896,7 @@ int main(int argc, char *argv[]) {
     debug_dump_tokens(prog, tokens);
 
   if (flag_debug_only_tokenize)
-    exit(0);
+    return 0;
 
   /* Parser... */
   Token *tok = (Token *)vector_data(tokens);
@@ -659,10 +908,16 @@ int main(int argc, char *argv[]) {
   /* Generate IR ... */
   BasicBlock bb = find_or_make_bb("start");
   gen_ir_for_stmt(bb, stmt);
+  if (flag_profile_use)
+    load_profile(flag_profile_use, bb);
+
   if (flag_debug_dump_ir) {
     BasicBlock curbb = NULL;
     for (curbb = bb; curbb; curbb = bb->cfg_next_bb) {
-      printf("%s:\n", curbb->name);
+      if (flag_profile_use)
+        printf("%s: # count: %lu\n", curbb->name, curbb->count);
+      else
+        printf("%s:\n", curbb->name);
 
       switch (curbb->jmp.kind) {
       case JMP_RET:
@@ -676,12 +931,15 @@ int main(int argc, char *argv[]) {
   }
 
   if (flag_debug_only_dump_ir)
-    exit(0);
+    return 0;
 
   /* CodeGen ... */
   BasicBlock curbb = NULL;
   for (curbb = bb; curbb; curbb = bb->cfg_next_bb) {
     /* TODO: Add support for emitting instructions. */
+    if (flag_instrument)
+      emit_profile_counter(curbb);
+
     switch (curbb->jmp.kind) {
     case JMP_RET:
       printf("\tret\n");
@@ -691,5 +949,270 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  if (flag_instrument)
+    emit_profile_runtime(bb, flag_instrument);
+
   return 0;
 }
+
+/*
+ * Compile server.
+ *
+ * Both directions of the protocol are sequences of length-prefixed blobs over
+ * a Unix stream socket. A request is the client's working directory, which
+ * the worker switches to so relative paths resolve as they would locally, then
+ * a u32 argument count followed by one blob per argument (the client's command
+ * line minus the program name). The response is a u32 exit status followed by
+ * the captured stdout and stderr, each streamed as a sequence of blobs that
+ * ends with an empty one so output size is not bounded by a length prefix.
+ *
+ * The server forks a worker per request. The worker inherits the already
+ * initialized process, so startup costs are paid once, while everything the
+ * request mutates (flags, the basic block table, the heap) is thrown away with
+ * the worker, which gives every request a fresh context.
+ */
+
+#define SERVER_MAX_ARGS 4096
+#define SERVER_MAX_BLOB (256u << 20)
+#define SERVER_STREAM_CHUNK (64 * 1024)
+
+static bool write_full(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_full(int fd, void *buf, size_t len) {
+  char *p = buf;
+  while (len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool send_blob(int fd, const void *buf, size_t len) {
+  /* Longer blobs would get a truncated length prefix and corrupt the stream. */
+  if (len > UINT32_MAX)
+    return false;
+
+  u32 len32 = len;
+  return write_full(fd, &len32, sizeof(len32)) && write_full(fd, buf, len);
+}
+
+/* Returns a null-terminated copy of the next blob, or NULL on EOF. */
+static char *recv_blob(int fd, u32 *len_ref) {
+  u32 len;
+  if (!read_full(fd, &len, sizeof(len)) || len > SERVER_MAX_BLOB)
+    return NULL;
+
+  char *buf = malloc((size_t)len + 1);
+  if (!buf)
+    fatalf("failed to allocate memory\n");
+  if (!read_full(fd, buf, len)) {
+    free(buf);
+    return NULL;
+  }
+  buf[len] = '\0';
+  if (len_ref)
+    *len_ref = len;
+  return buf;
+}
+
+/* Streams the contents of f as blobs, terminated by an empty blob. */
+static bool send_file(int fd, FILE *f) {
+  char buf[SERVER_STREAM_CHUNK];
+  size_t n;
+
+  rewind(f);
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+    if (!send_blob(fd, buf, n))
+      return false;
+  }
+  return !ferror(f) && send_blob(fd, buf, 0);
+}
+
+/* Copies a stream written by send_file() to f. */
+static bool recv_file(int fd, FILE *f) {
+  while (1) {
+    u32 len;
+    char *buf = recv_blob(fd, &len);
+    if (!buf)
+      return false;
+    fwrite(buf, 1, len, f);
+    free(buf);
+    if (len == 0)
+      return true;
+  }
+}
+
+static int open_socket(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path))
+    fatalf("socket path too long: '%s'\n", path);
+  strcpy(addr->sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    fatalf("failed to create socket: %s\n", strerror(errno));
+  return fd;
+}
+
+/* Runs in the forked worker and returns the worker's exit status. */
+static int serve_request(int conn) {
+  char *cwd = recv_blob(conn, NULL);
+  if (!cwd || chdir(cwd) < 0)
+    return 1;
+
+  u32 nargs;
+  if (!read_full(conn, &nargs, sizeof(nargs)) || nargs > SERVER_MAX_ARGS)
+    return 1;
+
+  /* argv[0] and the terminating NULL are not sent over the wire. */
+  char **args = calloc(nargs + 2, sizeof(char *));
+  if (!args)
+    return 1;
+  args[0] = "cc";
+  for (u32 i = 0; i < nargs; ++i) {
+    if ((args[i + 1] = recv_blob(conn, NULL)) == NULL)
+      return 1;
+  }
+
+  FILE *out = tmpfile();
+  FILE *err = tmpfile();
+  if (!out || !err)
+    return 1;
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(fileno(out), STDOUT_FILENO);
+  dup2(fileno(err), STDERR_FILENO);
+
+  jmp_buf env;
+  u32 status;
+  if (setjmp(env) == 0) {
+    fatal_jmp = &env;
+    reset_args();
+    parse_args(nargs + 1, args);
+    status = compile(nargs + 1, args);
+  } else {
+    status = 1;
+  }
+  fatal_jmp = NULL;
+
+  fflush(stdout);
+  fflush(stderr);
+  if (!write_full(conn, &status, sizeof(status)) || !send_file(conn, out) ||
+      !send_file(conn, err))
+    return 1;
+  return 0;
+}
+
+static int run_server(const char *path) {
+  struct sockaddr_un addr;
+  int fd = open_socket(path, &addr);
+
+  /* Only replace a stale socket, never a file that happens to be in the way. */
+  struct stat st;
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode))
+      fatalf("refusing to replace '%s': not a socket\n", path);
+    unlink(path);
+  }
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    fatalf("failed to bind '%s': %s\n", path, strerror(errno));
+  if (listen(fd, SOMAXCONN) < 0)
+    fatalf("failed to listen on '%s': %s\n", path, strerror(errno));
+
+  /* A client hanging up must only fail its own worker. */
+  signal(SIGPIPE, SIG_IGN);
+
+  int jobs = flag_server_jobs;
+  if (jobs <= 0)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (jobs <= 0)
+    jobs = 1;
+
+  int nworkers = 0;
+  while (1) {
+    /* Reap finished workers, blocking while at the concurrency limit. */
+    while (nworkers > 0 &&
+           waitpid(-1, NULL, nworkers >= jobs ? 0 : WNOHANG) > 0)
+      --nworkers;
+
+    int conn = accept(fd, NULL, NULL);
+    if (conn < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      fatalf("failed to accept connection: %s\n", strerror(errno));
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fd);
+      _exit(serve_request(conn));
+    }
+    close(conn);
+
+    if (pid < 0)
+      fprintf(stderr, "failed to fork worker: %s\n", strerror(errno));
+    else
+      ++nworkers;
+  }
+}
+
+static int run_client(const char *path, int argc, char **argv) {
+  struct sockaddr_un addr;
+  int fd = open_socket(path, &addr);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    fatalf("failed to connect to '%s': %s\n", path, strerror(errno));
+
+  char *cwd = getcwd(NULL, 0);
+  if (!cwd)
+    fatalf("failed to get the working directory: %s\n", strerror(errno));
+
+  /* The server ignores `--client`, so the arguments are forwarded as is. */
+  u32 nargs = argc - 1;
+  bool ok = send_blob(fd, cwd, strlen(cwd)) &&
+            write_full(fd, &nargs, sizeof(nargs));
+  free(cwd);
+  for (int i = 1; ok && i < argc; ++i)
+    ok = send_blob(fd, argv[i], strlen(argv[i]));
+
+  u32 status;
+  if (!ok || !read_full(fd, &status, sizeof(status)) ||
+      !recv_file(fd, stdout) || !recv_file(fd, stderr))
+    fatalf("lost connection to the compile server\n");
+
+  close(fd);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  /* Built before forking so compile server workers start with it warm. */
+  init_punctuators();
+  parse_args(argc, argv);
+
+  if (flag_server)
+    return run_server(flag_server);
+
+  if (flag_client)
+    return run_client(flag_client, argc, argv);
+
+  return compile(argc, argv);
+}
@@ -127,3 +127,68 @@ start:
   ret
 EOF
 )
+
+./cc --server=./tmp/cc.sock &
+server_pid=$!
+trap 'kill $server_pid' EXIT
+for _ in $(seq 50); do
+    ./cc --client=./tmp/cc.sock --debug-only-tokenize '' 2>/dev/null && break
+    sleep 0.1
+done
+
+diff -u <(./cc --client=./tmp/cc.sock --debug-dump-ir --debug-only-dump-ir 'return') <(cat <<EOF
+start:
+  ret
+EOF
+)
+
+diff -u <(./cc --debug-only-tokenize --debug-dump-tokens '..%:%<<==>>>=') <(cat <<EOF
+TK_PUNCTUATOR '.' line: 1 column: 0
+TK_PUNCTUATOR '.' line: 1 column: 1
+TK_PUNCTUATOR '%:' line: 1 column: 2
+TK_PUNCTUATOR '%' line: 1 column: 4
+TK_PUNCTUATOR '<<=' line: 1 column: 5
+TK_PUNCTUATOR '=' line: 1 column: 8
+TK_PUNCTUATOR '>>' line: 1 column: 9
+TK_PUNCTUATOR '>=' line: 1 column: 11
+TK_EOF line: -1 column: -1
+EOF
+)
+
+(printf '%s\n' '.section .note.GNU-stack,"",@progbits' '.text' '.globl main' 'main:' 'movl $0, %eax'; ./cc --instrument=./tmp/instr.prof 'return') > ./tmp/instr.s
+gcc -static -o ./tmp/instr ./tmp/instr.s
+rm -f ./tmp/instr.prof
+./tmp/instr
+diff -u <(od -An -tx8 ./tmp/instr.prof) <(cat <<EOF
+ 0100464f52504343 0000000000000001
+ 0000000000000001
+EOF
+)
+
+printf 'CCPROF\x00\x01\x01\x00\x00\x00\x00\x00\x00\x00\x05\x00\x00\x00\x00\x00\x00\x00' > ./tmp/test.prof
+diff -u <(./cc --profile-use=./tmp/test.prof --debug-dump-ir --debug-only-dump-ir 'return') <(cat <<EOF
+start: # count: 5
+  ret
+EOF
+)
+
+printf 'CCP' > ./tmp/bad.prof
+diff -u <(./cc --profile-use=./tmp/bad.prof --debug-dump-ir 'return' 2>&1) <(cat <<EOF
+malformed profile './tmp/bad.prof'
+EOF
+)
+
+diff -u <(cd ./tmp && ../cc --client=cc.sock --profile-use=test.prof --debug-dump-ir --debug-only-dump-ir 'return') <(cat <<EOF
+start: # count: 5
+  ret
+EOF
+)
+
+prog="$(for i in $(seq 200); do echo "  return $i <<= %:%  ..."; echo; done)"
+diff -u <(./cc --lex-jobs=4 --debug-only-tokenize --debug-dump-tokens "$prog") <(./cc --lex-jobs=1 --debug-only-tokenize --debug-dump-tokens "$prog")
+printf '%s' "$prog" > ./tmp/prog.c
+diff -u <(./cc --lex-jobs=4 --source=./tmp/prog.c --debug-only-tokenize --debug-dump-tokens) <(./cc --lex-jobs=1 --debug-only-tokenize --debug-dump-tokens "$prog")
+
+for bad in $'return 1\n\tx\nreturn 2' $'return 1\nreturn 2\n$\nreturn 3'; do
+    diff -u <(./cc --lex-jobs=4 --debug-only-tokenize "$bad" 2>&1; echo "exit: $?") <(./cc --lex-jobs=1 --debug-only-tokenize "$bad" 2>&1; echo "exit: $?")
+done